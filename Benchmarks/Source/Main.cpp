@@ -0,0 +1,370 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Author:  Steven Vidal
+
+    console benchmarks for the ampsim dsp.
+        ampsim_benchmarks              runs every benchmark
+        ampsim_benchmarks denormals    only runs the ones named on the command line
+                                       (denormals, multirate, instances)
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "../../Source/PluginProcessor.h"
+
+#if JUCE_MAC || JUCE_LINUX
+ #include <sys/resource.h>
+#endif
+
+namespace
+{
+    double ticksToMicroseconds (juce::int64 ticks)
+    {
+        return juce::Time::highResolutionTicksToSeconds (ticks) * 1.0e6;
+    }
+
+    void setParameter (AmpsimAudioProcessor& processor, const juce::String& parameterID, float value)
+    {
+        auto* parameter = processor.apvts.getParameter (parameterID);
+        jassert (parameter != nullptr);
+        parameter->setValueNotifyingHost (parameter->convertTo0to1 (value));
+    }
+
+    //==============================================================================
+    /**
+     denormal tail benchmark
+     feeds a loud noise burst through the filter cascade followed by silence and times every block.
+     the settings are picked so the feedback states take as long as possible to decay:
+     48 db/oct low cut at 20hz and a narrow +24db peak at 60hz.
+     runs with FTZ off (what the chain gets when a host calls it without FTZ) and on. the IIR filters snap
+     their own state at the end of every block in both runs, so this shows what FTZ adds on top of that
+     */
+    struct TailProtection
+    {
+        const char* name;
+        bool flushToZero;
+    };
+
+    struct TailTimings
+    {
+        double loudMean = 0, tailMean = 0, tailPeak = 0;
+    };
+
+    TailTimings timeDecayingTail (AmpsimAudioProcessor::MonoChain& chain, int blockSize, const TailProtection& protection)
+    {
+        constexpr int numLoudBlocks = 50;
+        constexpr int numTailBlocks = 800;
+
+        juce::FloatVectorOperations::disableDenormalisedNumberSupport (protection.flushToZero);
+
+        juce::AudioBuffer<float> buffer (1, blockSize);
+        juce::Random random (0x5eed);
+        TailTimings timings;
+
+        chain.reset();
+
+        for (int i = 0; i < numLoudBlocks + numTailBlocks; ++i)
+        {
+            const bool loud = i < numLoudBlocks;
+
+            if (loud)
+                for (int n = 0; n < blockSize; ++n)
+                    buffer.setSample (0, n, 0.9f * (2.0f * random.nextFloat() - 1.0f));
+            else
+                buffer.clear();
+
+            juce::dsp::AudioBlock<float> block (buffer);
+            juce::dsp::ProcessContextReplacing<float> context (block);
+
+            auto start = juce::Time::getHighResolutionTicks();
+            chain.process (context);
+            auto elapsed = ticksToMicroseconds (juce::Time::getHighResolutionTicks() - start);
+
+            if (loud)
+            {
+                timings.loudMean += elapsed / numLoudBlocks;
+            }
+            else
+            {
+                timings.tailMean += elapsed / numTailBlocks;
+                timings.tailPeak = juce::jmax (timings.tailPeak, elapsed);
+            }
+        }
+
+        juce::FloatVectorOperations::disableDenormalisedNumberSupport (false);
+        return timings;
+    }
+
+    void runDenormalTailBenchmark()
+    {
+        constexpr double sampleRate = 48000.0;
+        constexpr int blockSize = 256;
+
+        AmpsimAudioProcessor processor;
+        setParameter (processor, "LowCut Freq", 20.0f);
+        setParameter (processor, "LowCut Slope", 3.0f);
+        setParameter (processor, "Peak Freq", 60.0f);
+        setParameter (processor, "Peak Gain", 24.0f);
+        setParameter (processor, "Peak Quality", 10.0f);
+        processor.prepareToPlay (sampleRate, blockSize);
+
+        std::cout << "denormal tail (" << blockSize << " samples @ " << sampleRate << " hz, microseconds per block)" << std::endl;
+
+        const TailProtection protections[] = { { "ftz off", false },
+                                               { "ftz on ", true  } };
+
+        for (auto& protection : protections)
+        {
+            auto timings = timeDecayingTail (processor.leftChain, blockSize, protection);
+
+            std::cout << "  " << protection.name
+                      << "  loud mean " << juce::String (timings.loudMean, 2)
+                      << "  tail mean " << juce::String (timings.tailMean, 2)
+                      << "  tail peak " << juce::String (timings.tailPeak, 2)
+                      << "  spike x" << juce::String (timings.tailPeak / juce::jmax (timings.loudMean, 1.0e-3), 1)
+                      << std::endl;
+        }
+
+        processor.releaseResources();
+    }
+
+    //==============================================================================
+    /**
+     multirate benchmark
+     passband error: sines through the decimate -> interpolate edges of MultirateProcessor with nothing
+     in between, the gain error in db is measured once the filters have settled.
+     convolution cpu: a 50ms IR convolved at the session rate against the same IR inside the multirate wrapper
+     */
+    struct PassThrough
+    {
+        void prepare (const juce::dsp::ProcessSpec&) {}
+        template <typename ProcessContext> void process (const ProcessContext&) noexcept {}
+        void reset() noexcept {}
+        int getLatency() const noexcept { return 0; }
+    };
+
+    struct ConvolutionStage
+    {
+        void prepare (const juce::dsp::ProcessSpec& spec)  { convolution.prepare (spec); }
+        template <typename ProcessContext> void process (const ProcessContext& context) noexcept { convolution.process (context); }
+        void reset() noexcept                               { convolution.reset(); }
+        int getLatency() const noexcept                     { return convolution.getLatency(); }
+
+        juce::dsp::Convolution convolution;
+    };
+
+    constexpr int multirateBlockSize = 512;
+
+    double measurePassbandErrorDecibels (double sampleRate, double frequency)
+    {
+        MultirateProcessor<float, PassThrough> multirate;
+        multirate.prepare ({ sampleRate, (juce::uint32) multirateBlockSize, 1 });
+
+        juce::AudioBuffer<float> buffer (1, multirateBlockSize);
+        const auto settleSamples = (int) sampleRate / 4;
+        const auto measureSamples = (int) sampleRate / 2;
+        auto phaseIncrement = juce::MathConstants<double>::twoPi * frequency / sampleRate;
+        double phase = 0, inputEnergy = 0, outputEnergy = 0;
+
+        for (int position = 0; position < settleSamples + measureSamples; position += multirateBlockSize)
+        {
+            for (int n = 0; n < multirateBlockSize; ++n)
+            {
+                buffer.setSample (0, n, (float) std::sin (phase));
+                phase += phaseIncrement;
+            }
+
+            auto input = buffer.getRMSLevel (0, 0, multirateBlockSize);
+
+            juce::dsp::AudioBlock<float> block (buffer);
+            multirate.process (juce::dsp::ProcessContextReplacing<float> (block));
+
+            if (position >= settleSamples)
+            {
+                inputEnergy += input * input;
+                outputEnergy += std::pow (buffer.getRMSLevel (0, 0, multirateBlockSize), 2.0);
+            }
+        }
+
+        return juce::Decibels::gainToDecibels (std::sqrt (outputEnergy / inputEnergy), -200.0);
+    }
+
+    double secondsPerSecondOfAudio (std::function<void (juce::dsp::AudioBlock<float>&)> process, double sampleRate)
+    {
+        juce::AudioBuffer<float> buffer (2, multirateBlockSize);
+        juce::Random random (0x5eed);
+        const auto numBlocks = (int) (2.0 * sampleRate) / multirateBlockSize;
+        juce::int64 total = 0;
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            for (int channel = 0; channel < 2; ++channel)
+                for (int n = 0; n < multirateBlockSize; ++n)
+                    buffer.setSample (channel, n, 0.5f * (2.0f * random.nextFloat() - 1.0f));
+
+            juce::dsp::AudioBlock<float> block (buffer);
+            auto start = juce::Time::getHighResolutionTicks();
+            process (block);
+            total += juce::Time::getHighResolutionTicks() - start;
+        }
+
+        return juce::Time::highResolutionTicksToSeconds (total) / 2.0;
+    }
+
+    juce::AudioBuffer<float> makeCabLikeImpulseResponse (double sampleRate)
+    {
+        const auto irLength = (int) (0.05 * sampleRate);
+
+        //exponentially decaying noise, stands in for a cab IR
+        juce::AudioBuffer<float> ir (2, irLength);
+        juce::Random random (0xcab);
+        for (int channel = 0; channel < 2; ++channel)
+            for (int n = 0; n < irLength; ++n)
+                ir.setSample (channel, n, (2.0f * random.nextFloat() - 1.0f) * std::exp (-6.0f * (float) n / (float) irLength));
+
+        return ir;
+    }
+
+    void loadAndPrepare (juce::dsp::Convolution& convolution, double irSampleRate)
+    {
+        convolution.loadImpulseResponse (makeCabLikeImpulseResponse (irSampleRate), irSampleRate,
+                                         juce::dsp::Convolution::Stereo::yes,
+                                         juce::dsp::Convolution::Trim::no,
+                                         juce::dsp::Convolution::Normalise::yes);
+    }
+
+    void runMultirateBenchmark()
+    {
+        std::cout << "multirate cab" << std::endl;
+
+        for (auto sampleRate : { 96000.0, 192000.0 })
+        {
+            double worstError = 0;
+            std::cout << "  " << sampleRate << " hz, factor " << MultirateProcessor<float, PassThrough>::getFactorForSampleRate (sampleRate)
+                      << ", passband error (db):";
+
+            for (auto frequency : { 100.0, 1000.0, 4000.0, 8000.0 })
+            {
+                auto error = measurePassbandErrorDecibels (sampleRate, frequency);
+                worstError = juce::jmax (worstError, std::abs (error));
+                std::cout << "  " << frequency << " hz " << juce::String (error, 4);
+            }
+
+            std::cout << "  worst " << juce::String (worstError, 4) << std::endl;
+
+            const juce::dsp::ProcessSpec spec { sampleRate, (juce::uint32) multirateBlockSize, 2 };
+
+            ConvolutionStage fullRate;
+            loadAndPrepare (fullRate.convolution, sampleRate);
+            fullRate.prepare (spec);
+
+            MultirateProcessor<float, ConvolutionStage> reducedRate;
+            loadAndPrepare (reducedRate.getProcessor().convolution, sampleRate);
+            reducedRate.prepare (spec);
+
+            //the IR gets resampled and partitioned on the convolution's own background thread
+            juce::Thread::sleep (500);
+
+            auto fullTime = secondsPerSecondOfAudio ([&fullRate] (juce::dsp::AudioBlock<float>& block)
+                                                     { fullRate.process (juce::dsp::ProcessContextReplacing<float> (block)); }, sampleRate);
+            auto reducedTime = secondsPerSecondOfAudio ([&reducedRate] (juce::dsp::AudioBlock<float>& block)
+                                                        { reducedRate.process (juce::dsp::ProcessContextReplacing<float> (block)); }, sampleRate);
+
+            std::cout << "  convolution cpu (ms per second of audio): session rate " << juce::String (fullTime * 1000.0, 3)
+                      << "  multirate " << juce::String (reducedTime * 1000.0, 3)
+                      << "  speedup x" << juce::String (fullTime / juce::jmax (reducedTime, 1.0e-9), 2)
+                      << "  latency " << reducedRate.getLatencyInSamples() << " samples" << std::endl;
+        }
+    }
+
+    //==============================================================================
+    /**
+     instance benchmark
+     what a host does when it scans or loads a session: construct a batch of instances, prepare them and
+     destroy them again, timed per instance. memory is the growth of the peak resident size while all the
+     instances are alive, so it's only reported where getrusage is available.
+     the precompute job count shows the shared setup work is bounded by the unique work, not the instance count
+     */
+    double getPeakResidentKilobytes()
+    {
+       #if JUCE_MAC || JUCE_LINUX
+        rusage usage;
+        getrusage (RUSAGE_SELF, &usage);
+        #if JUCE_MAC
+         return (double) usage.ru_maxrss / 1024.0; //bytes on mac
+        #else
+         return (double) usage.ru_maxrss;          //kilobytes on linux
+        #endif
+       #else
+        return 0.0;
+       #endif
+    }
+
+    void runInstanceBenchmark()
+    {
+        constexpr int numInstances = 100;
+        std::vector<std::unique_ptr<AmpsimAudioProcessor>> instances;
+        instances.reserve (numInstances);
+
+        //held here so the count covers every instance, the scheduler would go away with the last one otherwise
+        juce::SharedResourcePointer<PrecomputeScheduler> scheduler;
+        auto jobsBefore = scheduler->getNumJobsQueued();
+
+        auto peakBefore = getPeakResidentKilobytes();
+
+        auto start = juce::Time::getHighResolutionTicks();
+        for (int i = 0; i < numInstances; ++i)
+            instances.push_back (std::make_unique<AmpsimAudioProcessor>());
+        auto constructTime = ticksToMicroseconds (juce::Time::getHighResolutionTicks() - start);
+
+        auto peakConstructed = getPeakResidentKilobytes();
+
+        start = juce::Time::getHighResolutionTicks();
+        for (auto& instance : instances)
+            instance->prepareToPlay (48000.0, 512);
+        auto prepareTime = ticksToMicroseconds (juce::Time::getHighResolutionTicks() - start);
+
+        auto peakPrepared = getPeakResidentKilobytes();
+        auto jobsQueued = scheduler->getNumJobsQueued() - jobsBefore;
+
+        start = juce::Time::getHighResolutionTicks();
+        instances.clear();
+        auto destroyTime = ticksToMicroseconds (juce::Time::getHighResolutionTicks() - start);
+
+        std::cout << "instances (" << numInstances << ", ms per instance)" << std::endl
+                  << "  construct " << juce::String (constructTime / 1000.0 / numInstances, 4)
+                  << "  prepare " << juce::String (prepareTime / 1000.0 / numInstances, 4)
+                  << "  destroy " << juce::String (destroyTime / 1000.0 / numInstances, 4) << std::endl
+                  << "  precompute jobs queued " << jobsQueued << " (every instance asks for the same IR)" << std::endl;
+
+        if (peakBefore > 0.0)
+            std::cout << "  peak memory per instance (kb): constructed " << juce::String ((peakConstructed - peakBefore) / numInstances, 1)
+                      << "  prepared " << juce::String ((peakPrepared - peakBefore) / numInstances, 1) << std::endl;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    //the processor and its apvts need the message manager
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::StringArray benchmarks (argv + 1, argc - 1);
+    auto shouldRun = [&benchmarks] (const char* name) { return benchmarks.isEmpty() || benchmarks.contains (name); };
+
+    //first, the peak memory it reports is a high water mark the other benchmarks would already have raised
+    if (shouldRun ("instances"))
+        runInstanceBenchmark();
+
+    if (shouldRun ("denormals"))
+        runDenormalTailBenchmark();
+
+    if (shouldRun ("multirate"))
+        runMultirateBenchmark();
+
+    return 0;
+}
@@ -16,6 +16,7 @@ AmpsimAudioProcessor::AmpsimAudioProcessor()
                      #if ! JucePlugin_IsMidiEffect
                       #if ! JucePlugin_IsSynth
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                       .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
@@ -26,6 +27,7 @@ AmpsimAudioProcessor::AmpsimAudioProcessor()
 
 AmpsimAudioProcessor::~AmpsimAudioProcessor()
 {
+    stopTimer();
 }
 
 //==============================================================================
@@ -105,13 +107,47 @@ void AmpsimAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock
     leftChain.prepare(spec);
     rightChain.prepare(spec);
     
-    auto chainSettings = getChainSettings(apvts);
+    //not running blocks yet, so keep copying until one goes through without a writer in the middle of it
+    parameters.invalidate();
+    while (parameters.read(chainSettings) == ChainParameters::nothingChanged)
+        juce::Thread::yield();
     /** CODE THAT WAS HERE PREVIOUSLY WAS UPDATED*/
 
     
     
     updateFilters();
     
+    //the driven path and the blend run on the whole stereo bus instead of one chain per channel
+    juce::dsp::ProcessSpec stereoSpec = spec;
+    stereoSpec.numChannels = (juce::uint32) getMainBusNumOutputChannels();
+    
+    if (drivenPath == nullptr)
+        drivenPath = std::make_unique<AudioEngine>();
+    
+    drivenPath->prepare(stereoSpec);
+    
+    //the cab IR is read on the shared precompute threads, the timer picks it up on the message thread once it's there.
+    //prepareToPlay can run on any thread so it never loads it itself
+    startTimer(50);
+    
+    auto drivenLatency = juce::jmin(drivenPath->getLatencySamples(), maxDrivenLatencySamples);
+    
+    //prepare() snaps the mix smoother to the current proportion instead of ramping to it
+    blendMixer.setWetMixProportion(chainSettings.driveMix);
+    blendMixer.prepare(stereoSpec);
+    blendMixer.setWetLatency(drivenLatency);
+    setLatencySamples(drivenLatency);
+    
+    //the mixer ramps the wet level over 50ms, keep the driven path alive until that has finished
+    drivenPathReleaseSamples = (int) (0.05 * sampleRate) + samplesPerBlock;
+    drivenPathHoldSamples = 0;
+    
+    sidechainFollower.prepare(spec);
+    sidechainFollower.setLevelCalculationType(juce::dsp::BallisticsFilterLevelCalculationType::peak);
+    sidechainFollower.setAttackTime(1.0f);
+    sidechainFollower.setReleaseTime(100.0f);
+    sidechainGain.setSize(1, samplesPerBlock);
+    
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
 }
@@ -141,6 +177,13 @@ bool AmpsimAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) c
    #if ! JucePlugin_IsSynth
     if (layouts.getMainOutputChannelSet() != layouts.getMainInputChannelSet())
         return false;
+    
+    //the sidechain is optional, only mono or stereo keys
+    auto sidechain = layouts.getChannelSet(true, 1);
+    if (! sidechain.isDisabled()
+     && sidechain != juce::AudioChannelSet::mono()
+     && sidechain != juce::AudioChannelSet::stereo())
+        return false;
    #endif
 
     return true;
@@ -165,14 +208,50 @@ void AmpsimAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce:
         buffer.clear (i, 0, buffer.getNumSamples());
 
     
-    //taken from the prepareToPlay function
-    auto chainSettings = getChainSettings(apvts);
-  
-    updateFilters();
+    //taken from the prepareToPlay function, the filters only get redesigned when one of the eq parameters changed.
+    //drive mix and the sidechain are read straight out of chainSettings further down
+    if ((parameters.read(chainSettings) & ChainParameters::filterParametersChanged) != 0)
+        updateFilters();
+    
+    
+    //the sidechain channels come after the main bus in the buffer, only work on the main bus from here
+    auto mainBuffer = getBusBuffer(buffer, false, 0);
+    juce::dsp::AudioBlock<float> block(mainBuffer);
+    
+    /**
+     parallel blend: the clean signal is copied into the mixer (and delayed by the driven path latency),
+     the driven path processes the block in place and the mixer blends the two back together
+     */
+    if (chainSettings.driveMix > 0.0f)
+    {
+        //coming back after the driven path was skipped, don't let it resume from whatever state it stopped in
+        if (drivenPathHoldSamples <= 0 && drivenPath != nullptr)
+        {
+            drivenPath->reset();
+            sidechainFollower.reset();
+        }
+        
+        drivenPathHoldSamples = drivenPathReleaseSamples;
+    }
+    
+    blendMixer.setWetMixProportion(chainSettings.driveMix);
+    blendMixer.pushDrySamples(block);
+    
+    if (drivenPathHoldSamples > 0 && drivenPath != nullptr)
+    {
+        drivenPath->process_convolution(juce::dsp::ProcessContextReplacing<float>(block));
+        
+        auto sidechain = getBusBuffer(buffer, true, 1);
+        if (chainSettings.sidechainKey && sidechain.getNumChannels() > 0)
+            applySidechainKey(sidechain, block, chainSettings);
+        
+        drivenPathHoldSamples -= (int) block.getNumSamples();
+    }
+    
+    blendMixer.mixWetSamples(block);
     
     
     //need to extract the left and right channels from the block that contains the buffer
-    juce::dsp::AudioBlock<float> block(buffer);
 
     auto leftBlock = block.getSingleChannelBlock(0);
     auto rightBlock = block.getSingleChannelBlock(1);
@@ -183,8 +262,6 @@ void AmpsimAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce:
     
     leftChain.process(leftContext);
     rightChain.process(rightContext);
-    
-    
 }
 
 //==============================================================================
@@ -215,24 +292,122 @@ void AmpsimAudioProcessor::setStateInformation (const void* data, int sizeInByte
     // whose contents will have been created by the getStateInformation() call.
 }
 
-//helper function to get the parameters of the audiotreevaluestate
-ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts){
-    ChainSettings settings;
+//==============================================================================
+ChainParameters::ChainParameters(juce::AudioProcessorValueTreeState& state) : apvts(state)
+{
+    static_assert(sizeof(ValueBlock) <= 64, "the value block is meant to fit in one cache line");
+    
     /**
-            taking the values from the audiotreevaluestate and putting them into the settings struct
+            the only string keyed lookups, done once here instead of on every block.
+            same order as the Parameter enum
      */
-    settings.lowCutFreq = apvts.getRawParameterValue("LowCut Freq")->load(); //doesn't return a     normalized value
-    settings.highCutFreq= apvts.getRawParameterValue("HighCut Freq")->load();
-    settings.peakFreq = apvts.getRawParameterValue("Peak Freq")->load();
-    settings.peakGainInDecibels = apvts.getRawParameterValue("Peak Gain")->load();
-    settings.peakQuality = apvts.getRawParameterValue("Peak Quality")->load();
+    parameterIDs = { "LowCut Freq", "LowCut Slope", "HighCut Freq", "HighCut Slope",
+                     "Peak Freq", "Peak Gain", "Peak Quality",
+                     "Drive Mix", "Sidechain Key", "Sidechain Threshold" };
+    jassert(parameterIDs.size() == numParameters);
+    
+    for (int parameter = 0; parameter < numParameters; ++parameter)
+    {
+        auto* value = apvts.getRawParameterValue(parameterIDs[parameter]);
+        jassert(value != nullptr); //the id has to match one in createParameterLayout
+        
+        block.values[parameter].store(value->load(), std::memory_order_relaxed);
+        apvts.addParameterListener(parameterIDs[parameter], this);
+    }
+    
+    for (auto& changes : block.groupChanges)
+        changes.store(0, std::memory_order_relaxed);
+}
+
+ChainParameters::~ChainParameters()
+{
+    for (auto& parameterID : parameterIDs)
+        apvts.removeParameterListener(parameterID, this);
+}
+
+void ChainParameters::parameterChanged(const juce::String& parameterID, float newValue)
+{
+    auto parameter = parameterIDs.indexOf(parameterID);
+    jassert(parameter >= 0);
+    if (parameter < 0)
+        return;
+    
+    //host automation and the editor can write at the same time, only one of them gets to make the sequence odd
+    auto sequence = block.sequence.load(std::memory_order_relaxed);
+    while ((sequence & 1) != 0
+           || ! block.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_relaxed))
+        sequence = block.sequence.load(std::memory_order_relaxed);
     
-    settings.lowCutSlope =static_cast<Slope>(apvts.getRawParameterValue("LowCut Slope")->load());
-    settings.highCutSlope = static_cast<Slope>(apvts.getRawParameterValue("HighCut Slope")->load());
+    //the odd sequence has to be visible before any of the value stores
+    std::atomic_thread_fence(std::memory_order_release);
     
-    return settings;
+    block.values[parameter].store(newValue, std::memory_order_relaxed);
+    auto& changes = block.groupChanges[getGroup(parameter)];
+    changes.store(changes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    
+    block.sequence.store(sequence + 2, std::memory_order_release);
 }
 
+int ChainParameters::read(ChainSettings& settings) noexcept
+{
+    auto before = block.sequence.load(std::memory_order_acquire);
+    if (before == lastReadSequence && ! invalidated)
+        return nothingChanged;
+    
+    //a write landing in the middle of the copy shows up as an odd or moved sequence, copy again.
+    //bounded: if the writers keep it moving settings are left alone and the next block reads again
+    for (int attempt = 0; attempt < 4; ++attempt)
+    {
+        if ((before & 1) != 0)
+        {
+            before = block.sequence.load(std::memory_order_acquire);
+            continue;
+        }
+        
+        float values[numParameters];
+        juce::uint32 groupChanges[numGroups];
+        
+        for (int parameter = 0; parameter < numParameters; ++parameter)
+            values[parameter] = block.values[parameter].load(std::memory_order_relaxed);
+        
+        for (int group = 0; group < numGroups; ++group)
+            groupChanges[group] = block.groupChanges[group].load(std::memory_order_relaxed);
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto after = block.sequence.load(std::memory_order_relaxed);
+        if (after != before)
+        {
+            before = after;
+            continue;
+        }
+        
+        settings.lowCutFreq = values[lowCutFreq]; //doesn't return a normalized value
+        settings.highCutFreq = values[highCutFreq];
+        settings.peakFreq = values[peakFreq];
+        settings.peakGainInDecibels = values[peakGain];
+        settings.peakQuality = values[peakQuality];
+        
+        settings.lowCutSlope = static_cast<Slope>(values[lowCutSlope]);
+        settings.highCutSlope = static_cast<Slope>(values[highCutSlope]);
+        
+        settings.driveMix = values[driveMix];
+        settings.sidechainKey = values[sidechainKey] > 0.5f;
+        settings.sidechainThresholdInDecibels = values[sidechainThreshold];
+        
+        int changed = nothingChanged;
+        if (invalidated || groupChanges[filterGroup] != lastGroupChanges[filterGroup])
+            changed |= filterParametersChanged;
+        if (invalidated || groupChanges[blendGroup] != lastGroupChanges[blendGroup])
+            changed |= blendParametersChanged;
+        
+        std::copy(groupChanges, groupChanges + numGroups, lastGroupChanges);
+        lastReadSequence = before;
+        invalidated = false;
+        return changed;
+    }
+    
+    return nothingChanged;
+}
 
 
 
@@ -296,6 +471,19 @@ juce::AudioProcessorValueTreeState::ParameterLayout AmpsimAudioProcessor::create
         // choice functions allows for a drop down menu, just for representing them
         layout.add(std::make_unique<juce::AudioParameterChoice>("LowCut Slope","LowCut Slope",stringArray,0));
         layout.add(std::make_unique<juce::AudioParameterChoice>("HighCut Slope","HighCut Slope",stringArray,0));
+    
+    //blend between the clean path (0) and the driven path (1)
+    layout.add(std::make_unique<juce::AudioParameterFloat>("Drive Mix",
+                                                           "Drive Mix",
+                                                           juce::NormalisableRange<float>(0.f,1.f, 0.01f,1.f),
+                                                           0.f));
+    
+    //when on, the sidechain input opens the driven path like a keyed gate
+    layout.add(std::make_unique<juce::AudioParameterBool>("Sidechain Key","Sidechain Key",false));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("Sidechain Threshold",
+                                                           "Sidechain Threshold",
+                                                           juce::NormalisableRange<float>(-60.f,0.f, 0.5f,1.f),
+                                                           -30.f));
                    
         return layout;
         
@@ -331,7 +519,7 @@ void AmpsimAudioProcessor::updateHighCutFilters(const ChainSettings &chainSettin
     
     auto highCutCoeefficients = juce::dsp::FilterDesign<float>::designIIRLowpassHighOrderButterworthMethod(chainSettings.highCutFreq,
                                                                                                            getSampleRate(),
-                                                                                                           2 * (chainSettings.highCutFreq + 1));
+                                                                                                           2 * (chainSettings.highCutSlope + 1));
     auto& leftHighCut = leftChain.get<ChainPosititions::highCut>();
     auto& rightHighCut = rightChain.get<ChainPosititions::highCut>();
     
@@ -340,8 +528,38 @@ void AmpsimAudioProcessor::updateHighCutFilters(const ChainSettings &chainSettin
     
     
 }
+void AmpsimAudioProcessor::timerCallback(){
+    if (drivenPath == nullptr || drivenPath->applyPendingResources())
+        stopTimer();
+}
+
+/**
+ keyed gate on the driven path: follows the sidechain envelope and scales the driven signal by
+ envelope / threshold (clamped to 1), so it is fully open once the key goes over the threshold
+ */
+void AmpsimAudioProcessor::applySidechainKey(juce::AudioBuffer<float>& sidechain,
+                                             juce::dsp::AudioBlock<float>& driven,
+                                             const ChainSettings& chainSettings){
+    auto numSamples = juce::jmin((int) driven.getNumSamples(), sidechainGain.getNumSamples());
+    jassert(numSamples == (int) driven.getNumSamples()); //bigger block than prepareToPlay announced
+    
+    auto inverseThreshold = 1.0f / juce::Decibels::decibelsToGain(chainSettings.sidechainThresholdInDecibels);
+    
+    //a stereo key is followed on its first channel only
+    auto* key = sidechain.getReadPointer(0);
+    auto* gain = sidechainGain.getWritePointer(0);
+    
+    for (int i = 0; i < numSamples; ++i)
+        gain[i] = juce::jmin(1.0f, sidechainFollower.processSample(0, key[i]) * inverseThreshold);
+    
+    //only the block process() snaps the envelope state, per sample it decays into denormals once the key goes quiet
+    sidechainFollower.snapToZero();
+    
+    for (size_t channel = 0; channel < driven.getNumChannels(); ++channel)
+        juce::FloatVectorOperations::multiply(driven.getChannelPointer(channel), gain, numSamples);
+}
+
 void AmpsimAudioProcessor::updateFilters(){
-    auto chainSettings = getChainSettings(apvts);
     updateLowCutFilters(chainSettings);
     updatePeakFilter(chainSettings);
     updateHighCutFilters(chainSettings);
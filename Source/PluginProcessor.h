@@ -9,6 +9,9 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "my_denormals.h"
+#include "my_convolution.h"
+#include "my_blend.h"
 
 //need to extract parameters from the audio processor value tree state
 // implementing a struct
@@ -26,16 +29,103 @@ struct ChainSettings{
     float lowCutFreq{0}, highCutFreq{0};
     
     Slope lowCutSlope{Slope::Slope_12}, highCutSlope{Slope::Slope_12};
+    
+    //parallel blend between the clean and driven paths, 0 = clean only
+    float driveMix{0};
+    
+    //sidechain keys the driven path open once it gets above the threshold
+    bool sidechainKey{false};
+    float sidechainThresholdInDecibels{-30.f};
 };
 
 
-ChainSettings getChainSettings(juce::AudioProcessorValueTreeState& apvts);
+/**
+ typed access to the parameters the audio thread needs.
+ the values are mirrored into one block owned here (a single cache line) by the apvts listener callback,
+ so processBlock never does a string keyed apvts lookup or touches the apvts atomics.
+ the block is a seqlock: parameterChanged makes the sequence odd, writes the value and makes it even again,
+ read() costs a single atomic load while nothing changes and only accepts a copy taken while the sequence
+ stayed even and unchanged, so related parameters (freq + slope) are never torn
+ */
+class ChainParameters : private juce::AudioProcessorValueTreeState::Listener
+{
+public:
+    explicit ChainParameters(juce::AudioProcessorValueTreeState& apvts);
+    ~ChainParameters() override;
+    
+    /** what read() found changed, the eq only needs redesigning when one of its own parameters did*/
+    enum Changes
+    {
+        nothingChanged = 0,
+        filterParametersChanged = 1 << 0,
+        blendParametersChanged = 1 << 1
+    };
+    
+    /**
+     copies a consistent snapshot into settings and returns the Changes flags for it.
+     returns nothingChanged (and leaves settings alone) if nothing changed since the last read, or if
+     every copy was torn by a writer, the next read tries again then
+     */
+    int read(ChainSettings& settings) noexcept;
+    
+    /** makes the next read() copy the parameters and report everything as changed*/
+    void invalidate() noexcept { invalidated = true; }
+    
+private:
+    enum Parameter
+    {
+        lowCutFreq,
+        lowCutSlope,
+        highCutFreq,
+        highCutSlope,
+        peakFreq,
+        peakGain,
+        peakQuality,
+        driveMix,
+        sidechainKey,
+        sidechainThreshold,
+        numParameters
+    };
+    
+    //eq parameters come first, everything from driveMix on only affects the blend/sidechain
+    enum Group
+    {
+        filterGroup,
+        blendGroup,
+        numGroups
+    };
+    
+    static Group getGroup(int parameter) noexcept { return parameter < driveMix ? filterGroup : blendGroup; }
+    
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
+    
+    juce::AudioProcessorValueTreeState& apvts;
+    
+    //indexed by Parameter, only used to map the listener callback back to its slot
+    juce::StringArray parameterIDs;
+    
+    //written from whichever thread changed a parameter, copied by the audio thread
+    struct alignas(64) ValueBlock
+    {
+        std::atomic<juce::uint32> sequence{0}; //odd while a write is in progress
+        std::atomic<float> values[numParameters];
+        std::atomic<juce::uint32> groupChanges[numGroups]; //bumped with every write to one of the group's parameters
+    } block;
+    
+    //read by the audio thread only
+    juce::uint32 lastReadSequence = 0;
+    juce::uint32 lastGroupChanges[numGroups] {};
+    bool invalidated = true; //the first read always copies
+    
+    JUCE_DECLARE_NON_COPYABLE (ChainParameters)
+};
 
 
 //==============================================================================
 /**
 */
-class AmpsimAudioProcessor  : public juce::AudioProcessor
+class AmpsimAudioProcessor  : public juce::AudioProcessor,
+                              private juce::Timer
 {
 public:
     //==============================================================================
@@ -81,6 +171,11 @@ public:
     using APVT = juce::AudioProcessorValueTreeState::ParameterLayout;
     static APVT createParameterLayout();
     juce::AudioProcessorValueTreeState apvts {*this, nullptr,"Parameters",createParameterLayout()};
+    
+    ChainParameters parameters {apvts};
+    
+    /** latest parameter snapshot, only touched by the audio thread (and prepareToPlay)*/
+    ChainSettings chainSettings;
 
     //set up to processs mono audio, needs to process stereo so change,
     
@@ -158,9 +253,36 @@ public:
     void updateHighCutFilters(const ChainSettings& chainsettings);
     void updateFilters();
     
+    
+    /**
+     driven path: distortion -> cab, runs in parallel to the clean path and gets blended back in.
+     built on the first prepareToPlay, hosts scan plugins by constructing them so the constructor stays free of
+     disk access and thread start up (the cab IR read and the shared precompute threads come with the engine)
+     */
+    std::unique_ptr<AudioEngine> drivenPath;
+    
+    /**longest driven path latency the clean path can be delayed by*/
+    static constexpr int maxDrivenLatencySamples = 4096;
+    
+    /** delays the clean path by the driven path latency and mixes the two, buffers are allocated in prepareToPlay*/
+    LatencyCompensatedBlend<float> blendMixer {maxDrivenLatencySamples};
+    
+    juce::dsp::BallisticsFilter<float> sidechainFollower;
+    juce::AudioBuffer<float> sidechainGain;
+    
+    void applySidechainKey(juce::AudioBuffer<float>& sidechain,
+                           juce::dsp::AudioBlock<float>& driven,
+                           const ChainSettings& chainSettings);
 
                                         
 private:
+    /** polls the shared precompute threads until the driven path has everything it needs*/
+    void timerCallback() override;
+    
+    /** keeps the driven path running until the blend has faded out after the mix goes to 0*/
+    int drivenPathHoldSamples = 0;
+    int drivenPathReleaseSamples = 0;
+    
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AmpsimAudioProcessor)
 };
@@ -0,0 +1,131 @@
+/*
+  ==============================================================================
+
+    my_blend.h
+    Author:  Steven Vidal
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+/**
+ parallel dry/wet blend with the dry side delayed by a whole number of samples to line up with the wet side.
+ stands in for juce::dsp::DryWetMixer, whose DelayLine goes through the dry signal one interpolated sample at a
+ time even when there is no latency to make up. here the delay is a plain ring buffer moved with block copies
+ (skipped entirely at 0 latency) and the mix is a couple of FloatVectorOperations passes, linear rule
+ */
+template <typename Type>
+class LatencyCompensatedBlend
+{
+public:
+    explicit LatencyCompensatedBlend (int maximumLatencyInSamples) : maximumLatency (maximumLatencyInSamples) {}
+
+    /** allocates everything, the wet proportion set before this is where the mix starts (no ramp)*/
+    void prepare (const juce::dsp::ProcessSpec& spec)
+    {
+        dry.setSize ((int) spec.numChannels, (int) spec.maximumBlockSize);
+        ring.setSize ((int) spec.numChannels, maximumLatency);
+        gains.setSize (1, (int) spec.maximumBlockSize);
+
+        wetMix.reset (spec.sampleRate, 0.05);
+        wetMix.setCurrentAndTargetValue (wetMix.getTargetValue());
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        ring.clear();
+        ringPosition = 0;
+    }
+
+    /** the dry side gets delayed by this much, call from prepare only since it clears the delay*/
+    void setWetLatency (int numSamples) noexcept
+    {
+        jassert (numSamples <= maximumLatency);
+        latency = juce::jlimit (0, maximumLatency, numSamples);
+        reset();
+    }
+
+    void setWetMixProportion (Type newWetMix) noexcept { wetMix.setTargetValue (newWetMix); }
+
+    /** copies the dry block in, delayed by the wet latency*/
+    void pushDrySamples (const juce::dsp::AudioBlock<const Type> block) noexcept
+    {
+        auto numSamples = (int) block.getNumSamples();
+        auto numChannels = juce::jmin ((int) block.getNumChannels(), dry.getNumChannels());
+        jassert (numSamples <= dry.getNumSamples());
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            auto* input = block.getChannelPointer ((size_t) channel);
+            auto* output = dry.getWritePointer (channel);
+
+            if (latency == 0) {
+                juce::FloatVectorOperations::copy (output, input, numSamples);
+                continue;
+            }
+
+            //every ring slot holds the sample from `latency` ago, read it out and put the new one in its place
+            auto* delayed = ring.getWritePointer (channel);
+            auto position = ringPosition;
+
+            for (int done = 0; done < numSamples;)
+            {
+                auto chunk = juce::jmin (numSamples - done, latency - position);
+                juce::FloatVectorOperations::copy (output + done, delayed + position, chunk);
+                juce::FloatVectorOperations::copy (delayed + position, input + done, chunk);
+
+                done += chunk;
+                position = (position + chunk) % latency;
+            }
+        }
+
+        if (latency > 0)
+            ringPosition = (ringPosition + numSamples) % latency;
+    }
+
+    /** blends the delayed dry samples into the wet block: wet * mix + dry * (1 - mix)*/
+    void mixWetSamples (juce::dsp::AudioBlock<Type> block) noexcept
+    {
+        auto numSamples = (int) block.getNumSamples();
+        auto numChannels = juce::jmin ((int) block.getNumChannels(), dry.getNumChannels());
+
+        if (! wetMix.isSmoothing())
+        {
+            auto mix = wetMix.getTargetValue();
+            if (mix >= Type (1))
+                return;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* wet = block.getChannelPointer ((size_t) channel);
+                juce::FloatVectorOperations::multiply (wet, mix, numSamples);
+                juce::FloatVectorOperations::addWithMultiply (wet, dry.getReadPointer (channel), Type (1) - mix, numSamples);
+            }
+
+            return;
+        }
+
+        //while ramping: wet = dry + mix * (wet - dry), the ramp is worked out once for all channels
+        auto* mix = gains.getWritePointer (0);
+        for (int i = 0; i < numSamples; ++i)
+            mix[i] = wetMix.getNextValue();
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            auto* wet = block.getChannelPointer ((size_t) channel);
+            auto* delayedDry = dry.getReadPointer (channel);
+            juce::FloatVectorOperations::subtract (wet, delayedDry, numSamples);
+            juce::FloatVectorOperations::multiply (wet, mix, numSamples);
+            juce::FloatVectorOperations::add (wet, delayedDry, numSamples);
+        }
+    }
+
+private:
+    juce::AudioBuffer<Type> dry, ring, gains;
+    juce::SmoothedValue<Type> wetMix { Type (0) };
+    int maximumLatency = 0, latency = 0, ringPosition = 0;
+};
@@ -10,65 +10,171 @@
 
 #pragma once
 
+#include <JuceHeader.h>
+#include "my_multirate.h"
+#include "my_scheduler.h"
+
+/**
+ IR read from disk and resampled to the rate the cab runs at, by the shared scheduler.
+ not a CabSimulator<Type> member so a float and a double cab at the same rate share one result
+ */
+struct CabImpulseResponse
+{
+    juce::AudioBuffer<float> buffer;
+    double sampleRate = 0;
+};
+
 template <typename Type>
 class CabSimulator
 {
 public:
-    CabSimulator()
+    /** the old 1024 sample size limit, counted at the rate the IR file was recorded at*/
+    static constexpr int maxImpulseResponseSamples = 1024;
+    
+    /** hands the IR to the convolution once it is ready, message thread. true once it is loaded*/
+    bool applyImpulseResponseIfReady()
     {
-        auto dir = juce::File::getCurrentWorkingDirectory();
-        int numTries = 0;
-        while(!dir.getChildFile("project_resources").exists() && numTries++< 15) {
-            dir = dir.getParentDirectory();
-        }
+        const juce::ScopedLock sl(impulseResponseLock);
         
-        auto& convolution = processorChain.template get<convolutionIndex>();
+        if (impulseResponseApplied)
+            return true;
         
-        convolution.loadImpulseResponse     (dir.getChildFile("/Users/stevenvidal/Programming/CAPSTONE/ampsim/project_resources/guitar_amp.wav"),
-                                          juce::dsp::Convolution::Stereo::yes,
-                                          juce::dsp::Convolution::Trim::no,
-                                          1024);
-
+        if (impulseResponse == nullptr || ! impulseResponse->isReady())
+            return false;
+        
+        auto& ir = impulseResponse->get();
+        if (ir.buffer.getNumSamples() > 0)
+        {
+            convolution.loadImpulseResponse(juce::AudioBuffer<float>(ir.buffer),
+                                            ir.sampleRate,
+                                            ir.buffer.getNumChannels() > 1 ? juce::dsp::Convolution::Stereo::yes
+                                                                           : juce::dsp::Convolution::Stereo::no,
+                                            juce::dsp::Convolution::Trim::no,
+                                            juce::dsp::Convolution::Normalise::yes);
+        }
+        
+        impulseResponseApplied = true;
+        return true;
     }
 
     void prepare (const juce::dsp::ProcessSpec& spec) {
         
         /** post convolution filter
          */
-        auto& post_filter = processorChain.template get<postConvolutionFilter>();
-        post_filter.state = FilterCoefs::makeHighShelf(spec.sampleRate, 1500.0f,1.5f, 1.5f);
+        postFilter.state = FilterCoefs::makeHighShelf(spec.sampleRate, 1500.0f,1.5f, 1.5f);
         
-        processorChain.prepare(spec);
+        convolution.prepare(spec);
+        postFilter.prepare(spec);
+        
+        /**
+         the directory search, file read and resampling to the rate the cab runs at happen on the shared
+         precompute threads, once per rate: every instance at this rate gets the same buffer and the
+         convolution gets it at its own rate, so it has nothing left to resample
+         */
+        const juce::ScopedLock sl(impulseResponseLock);
+        if (spec.sampleRate != impulseResponseRate)
+        {
+            auto sampleRate = spec.sampleRate;
+            impulseResponse = scheduler->submit<CabImpulseResponse>("ir:guitar_amp.wav:" + juce::String(maxImpulseResponseSamples)
+                                                                    + ":" + juce::String(sampleRate),
+                                                                    [sampleRate] { return readImpulseResponse(maxImpulseResponseSamples, sampleRate); });
+            impulseResponseRate = sampleRate;
+            impulseResponseApplied = false;
+        }
     }
     
     template <typename ProcessContext>
     void process (const ProcessContext& context) noexcept {
         
+        convolution.process(context);
         
-        processorChain.process(context);
-        
+        //the convolution has written the output block, the post filter works on it in place
+        auto outputBlock = context.getOutputBlock();
+        postFilter.process(juce::dsp::ProcessContextReplacing<Type>(outputBlock));
     }
     void reset() noexcept {
-        processorChain.reset();
+        convolution.reset();
+        postFilter.reset();
+    }
+    
+    /** latency of the convolution engine in samples*/
+    int getLatency() const noexcept {
+        return convolution.getLatency();
     }
     
     
 private:
-    enum
+    /** runs on a precompute thread, reads at most maxSamples of the IR and resamples it to sampleRate*/
+    static CabImpulseResponse readImpulseResponse(int maxSamples, double sampleRate)
     {
-        convolutionIndex,
-        postConvolutionFilter
-    };
+        auto dir = juce::File::getCurrentWorkingDirectory();
+        int numTries = 0;
+        while(!dir.getChildFile("project_resources").exists() && numTries++< 15) {
+            dir = dir.getParentDirectory();
+        }
+        
+        auto file = dir.getChildFile("/Users/stevenvidal/Programming/CAPSTONE/ampsim/project_resources/guitar_amp.wav");
+        
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader (formatManager.createReaderFor(file));
+        
+        CabImpulseResponse ir;
+        if (reader == nullptr)
+            return ir;
+        
+        auto numSamples = (int) juce::jmin((juce::int64) maxSamples, reader->lengthInSamples);
+        juce::AudioBuffer<float> original((int) juce::jmin(2u, reader->numChannels), numSamples);
+        reader->read(&original, 0, numSamples, 0, true, true);
+        
+        ir.buffer = resample(original, reader->sampleRate, sampleRate);
+        ir.sampleRate = sampleRate;
+        return ir;
+    }
+    
+    /** the same resampling juce::dsp::Convolution would otherwise do for every instance on its loader thread*/
+    static juce::AudioBuffer<float> resample(juce::AudioBuffer<float>& source, double sourceRate, double targetRate)
+    {
+        if (juce::approximatelyEqual(sourceRate, targetRate))
+            return source;
+        
+        auto ratio = sourceRate / targetRate;
+        auto numSamples = juce::roundToInt(juce::jmax(1.0, source.getNumSamples() / ratio));
+        
+        juce::MemoryAudioSource memorySource(source, false);
+        juce::ResamplingAudioSource resampler(&memorySource, false, source.getNumChannels());
+        resampler.setResamplingRatio(ratio);
+        resampler.prepareToPlay(numSamples, sourceRate);
+        
+        juce::AudioBuffer<float> result(source.getNumChannels(), numSamples);
+        resampler.getNextAudioBlock({ &result, 0, numSamples });
+        return result;
+    }
+    
+    juce::SharedResourcePointer<PrecomputeScheduler> scheduler;
+    
+    //prepare swaps in the result for a new rate, the message thread hands it to the convolution
+    juce::CriticalSection impulseResponseLock;
+    std::shared_ptr<PrecomputeResult<CabImpulseResponse>> impulseResponse;
+    double impulseResponseRate = 0;
+    bool impulseResponseApplied = false;
+    
     /**name space used to make the filter calls within the DSP class easier to type out*/
     
     using Filter = juce::dsp::IIR::Filter<Type>;
     using FilterCoefs = juce::dsp::IIR::Coefficients<Type>; // converts mono filters into a multi-channel version
     
+    /**
+     a default constructed Convolution starts its own loader thread, every instance in the session
+     hands its IR loads to this one process wide queue instead. declared before the convolution that uses it
+     */
+    juce::SharedResourcePointer<juce::dsp::ConvolutionMessageQueue> convolutionQueue;
+    
     /*
-     this is the  decleration of the  convolution chain object
+     this is the  decleration of the  convolution -> post filter objects
      */
-    juce::dsp::ProcessorChain<juce::dsp::Convolution,
-    juce::dsp::ProcessorDuplicator<Filter,FilterCoefs>> processorChain;
+    juce::dsp::Convolution convolution { juce::dsp::Convolution::Latency { 0 }, *convolutionQueue };
+    juce::dsp::ProcessorDuplicator<Filter, FilterCoefs> postFilter;
     
     
 };
@@ -177,6 +283,20 @@ public:
         fxChain.process(context);
     }
     
+    void reset() noexcept {
+        fxChain.reset();
+    }
+    
+    /** loads whatever the precompute threads have finished (the cab IR), message thread only. true once there is nothing left*/
+    bool applyPendingResources() {
+        return fxChain.get<cabSimulatorIndex>().getProcessor().applyImpulseResponseIfReady();
+    }
+    
+    /** samples of delay the driven path adds, the clean path gets delayed by this much before blending*/
+    int getLatencySamples() const noexcept {
+        return fxChain.get<cabSimulatorIndex>().getLatencyInSamples();
+    }
+    
     
 private:
     enum
@@ -186,7 +306,11 @@ private:
         postConvolutionEQ,
     };
 
-    juce::dsp::ProcessorChain<Distortion<float>,CabSimulator<float>> fxChain;
+    /**
+     the cab response has nothing above ~8k, in 88.2k+ sessions it runs decimated to 44.1/48k
+     and the IR gets prepared at that rate, the distortion stays at the session rate
+     */
+    juce::dsp::ProcessorChain<Distortion<float>,MultirateProcessor<float, CabSimulator<float>>> fxChain;
 
 };
 
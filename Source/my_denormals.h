@@ -0,0 +1,38 @@
+/*
+  ==============================================================================
+
+    my_denormals.h
+    Author:  Steven Vidal
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+/**
+ juce::ScopedNoDenormals in processBlock only sets FTZ/DAZ on the audio thread while the block runs.
+ any thread we start ourselves (IR loading, analysers, offline renders) has to turn it on itself.
+ the filter states need nothing extra: IIR::Filter and BallisticsFilter process() already snap them to zero
+ at the end of every block (bypassed chain stages too), only processSample() callers have to call snapToZero()
+ */
+inline void disableDenormalsOnThisThread() noexcept
+{
+    juce::FloatVectorOperations::disableDenormalisedNumberSupport (true);
+}
+
+/** base class for the worker threads we spawn, FTZ/DAZ is already set when runWorker() is entered*/
+class DenormalSafeThread : public juce::Thread
+{
+public:
+    explicit DenormalSafeThread (const juce::String& threadName) : juce::Thread (threadName) {}
+
+    void run() final
+    {
+        disableDenormalsOnThisThread();
+        runWorker();
+    }
+
+    virtual void runWorker() = 0;
+};
@@ -0,0 +1,319 @@
+/*
+  ==============================================================================
+
+    my_multirate.h
+    Author:  Steven Vidal
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+/**
+ delay line for the polyphase filters, every sample is written twice so the last
+ `length` samples can always be read as one contiguous run: newest()[k] is x[n - k]
+ */
+template <typename Type>
+class HalfBandHistory
+{
+public:
+    void setLength(int newLength)
+    {
+        length = newLength;
+        samples.assign((size_t) (2 * length), Type(0));
+        writePos = 0;
+    }
+
+    void reset() noexcept {
+        std::fill(samples.begin(), samples.end(), Type(0));
+        writePos = 0;
+    }
+
+    void push(Type x) noexcept {
+        if (--writePos < 0)
+            writePos += length;
+
+        samples[(size_t) writePos] = x;
+        samples[(size_t) (writePos + length)] = x;
+    }
+
+    const Type* newest() const noexcept { return samples.data() + writePos; }
+
+private:
+    std::vector<Type> samples;
+    int length = 0, writePos = 0;
+};
+
+/** list of the nonzero taps of a kernel, half-band kernels have every other tap at zero*/
+template <typename Type>
+struct SparseTaps
+{
+    std::vector<int> offsets;
+    std::vector<Type> gains;
+
+    void add(int offset, Type gain) {
+        if (gain != Type(0)) {
+            offsets.push_back(offset);
+            gains.push_back(gain);
+        }
+    }
+
+    Type apply(const Type* history) const noexcept {
+        Type sum = 0;
+        for (size_t i = 0; i < offsets.size(); ++i)
+            sum += gains[i] * history[offsets[i]];
+        return sum;
+    }
+};
+
+/** one half-band decimation stage: takes two samples and gives back one*/
+template <typename Type>
+class HalfBandDecimator
+{
+public:
+    void setKernel(const std::vector<Type>& kernel)
+    {
+        taps = {};
+        for (size_t k = 0; k < kernel.size(); ++k)
+            taps.add((int) k, kernel[k]);
+
+        history.setLength((int) kernel.size());
+        phase = 0;
+    }
+
+    void reset() noexcept {
+        history.reset();
+        phase = 0;
+    }
+
+    /** returns true when a decimated sample was written to output, which is on every second call*/
+    bool push(Type x, Type& output) noexcept {
+        history.push(x);
+        phase ^= 1;
+
+        if (phase != 0)
+            return false;
+
+        output = taps.apply(history.newest());
+        return true;
+    }
+
+private:
+    SparseTaps<Type> taps;
+    HalfBandHistory<Type> history;
+    int phase = 0;
+};
+
+/** one half-band interpolation stage: zero stuffing + the kernel, split into its two phases*/
+template <typename Type>
+class HalfBandInterpolator
+{
+public:
+    void setKernel(const std::vector<Type>& kernel)
+    {
+        //times 2 to make up for the stuffed zeros
+        evenTaps = {};
+        oddTaps = {};
+        for (size_t k = 0; k < kernel.size(); ++k)
+            (k % 2 == 0 ? evenTaps : oddTaps).add((int) (k / 2), Type(2) * kernel[k]);
+
+        history.setLength((int) (kernel.size() + 1) / 2);
+    }
+
+    void reset() noexcept {
+        history.reset();
+    }
+
+    /** writes two output samples for every input sample*/
+    void push(Type x, Type* output) noexcept {
+        history.push(x);
+        output[0] = evenTaps.apply(history.newest());
+        output[1] = oddTaps.apply(history.newest());
+    }
+
+private:
+    SparseTaps<Type> evenTaps, oddTaps;
+    HalfBandHistory<Type> history;
+};
+
+/**
+ runs a processor at a reduced internal rate in high rate sessions.
+ 88.2/96k sessions are decimated by 2 and 176.4/192k by 4, so the wrapped processor always sees 44.1/48k.
+ the edges are cascaded polyphase half-band FIR stages (linear phase, so the latency is exact and can be
+ compensated), the wrapped processor is prepared at the internal rate and has to provide getLatency()
+ */
+template <typename Type, typename ProcessorType>
+class MultirateProcessor
+{
+public:
+    /** the equiripple design is good for ~90db of image/alias rejection and flat to about 0.2 fs */
+    static constexpr Type transitionWidth = Type(0.1);
+    static constexpr Type stopbandDecibels = Type(-90);
+
+    static int getFactorForSampleRate(double sampleRate) noexcept {
+        if (sampleRate >= 176000.0) return 4;
+        if (sampleRate >= 88000.0)  return 2;
+        return 1;
+    }
+
+    static std::vector<Type> designHalfBandKernel()
+    {
+        auto design = juce::dsp::FilterDesign<Type>::designFIRLowpassHalfBandEquirippleMethod(transitionWidth, stopbandDecibels);
+        auto* raw = design->getRawCoefficients();
+        return std::vector<Type>(raw, raw + design->coefficients.size());
+    }
+
+    void prepare(const juce::dsp::ProcessSpec& spec)
+    {
+        factor = getFactorForSampleRate(spec.sampleRate);
+        numStages = factor == 4 ? 2 : (factor == 2 ? 1 : 0);
+        numChannels = (int) spec.numChannels;
+
+        auto internalSpec = spec;
+        internalSpec.sampleRate = spec.sampleRate / factor;
+        internalSpec.maximumBlockSize = spec.maximumBlockSize / (juce::uint32) factor + 1;
+        processor.prepare(internalSpec);
+
+        if (factor == 1)
+            return;
+
+        //every instance uses the same kernel, the design is cheap so it is done once per process inline
+        //rather than queued behind the heavy jobs on the precompute threads
+        static const std::vector<Type> kernel = designHalfBandKernel();
+        setKernel(kernel);
+
+        lowRate.setSize(numChannels, (int) internalSpec.maximumBlockSize);
+        pending.setSize(numChannels, (int) spec.maximumBlockSize + 2 * factor);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        processor.reset();
+
+        for (auto& stage : decimators)    stage.reset();
+        for (auto& stage : interpolators) stage.reset();
+
+        /**
+         a decimated sample only comes out after `factor` inputs, priming the output with factor - 1 zeros
+         means there is always a full block ready without adding any more delay than the filters do
+         */
+        pending.clear();
+        numPending = factor - 1;
+    }
+
+    template <typename ProcessContext>
+    void process(const ProcessContext& context) noexcept
+    {
+        if (factor == 1) {
+            processor.process(context);
+            return;
+        }
+
+        auto&& inputBlock = context.getInputBlock();
+        auto&& outputBlock = context.getOutputBlock();
+        auto numSamples = (int) inputBlock.getNumSamples();
+        jassert(numSamples + numPending <= pending.getNumSamples());
+
+        int numLow = 0;
+        for (int channel = 0; channel < numChannels; ++channel)
+            numLow = decimate(channel, inputBlock.getChannelPointer((size_t) channel), numSamples);
+
+        if (numLow > 0) {
+            auto lowBlock = juce::dsp::AudioBlock<Type>(lowRate).getSubBlock(0, (size_t) numLow);
+            processor.process(juce::dsp::ProcessContextReplacing<Type>(lowBlock));
+        }
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            interpolate(channel, numLow);
+
+            auto* fifo = pending.getWritePointer(channel);
+            auto available = numPending + numLow * factor;
+            juce::FloatVectorOperations::copy(outputBlock.getChannelPointer((size_t) channel), fifo, numSamples);
+            std::memmove(fifo, fifo + numSamples, sizeof(Type) * (size_t) (available - numSamples));
+        }
+
+        numPending += numLow * factor - numSamples;
+    }
+
+    /** total delay at the session rate: every stage pair delays by (taps - 1) samples at its own rate*/
+    int getLatencyInSamples() const noexcept {
+        int latency = processor.getLatency() * factor;
+        for (int stage = 0; stage < numStages; ++stage)
+            latency += (kernelSize - 1) << stage;
+        return latency;
+    }
+
+    int getFactor() const noexcept { return factor; }
+
+    ProcessorType& getProcessor() noexcept { return processor; }
+    const ProcessorType& getProcessor() const noexcept { return processor; }
+
+private:
+    void setKernel(const std::vector<Type>& kernel)
+    {
+        kernelSize = (int) kernel.size();
+        decimators.resize((size_t) (numStages * numChannels));
+        interpolators.resize((size_t) (numStages * numChannels));
+
+        for (auto& stage : decimators)    stage.setKernel(kernel);
+        for (auto& stage : interpolators) stage.setKernel(kernel);
+    }
+
+    //stage 0 runs at the session rate, stage 1 at half of it
+    size_t stageIndex(int stage, int channel) const noexcept { return (size_t) (stage * numChannels + channel); }
+
+    int decimate(int channel, const Type* input, int numSamples) noexcept
+    {
+        auto* low = lowRate.getWritePointer(channel);
+        auto& first = decimators[stageIndex(0, channel)];
+        int numLow = 0;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            Type sample;
+            if (! first.push(input[i], sample))
+                continue;
+
+            if (numStages == 2 && ! decimators[stageIndex(1, channel)].push(sample, sample))
+                continue;
+
+            low[numLow++] = sample;
+        }
+
+        return numLow;
+    }
+
+    void interpolate(int channel, int numLow) noexcept
+    {
+        auto* low = lowRate.getReadPointer(channel);
+        auto* output = pending.getWritePointer(channel) + numPending;
+        auto& last = interpolators[stageIndex(0, channel)];
+
+        for (int i = 0; i < numLow; ++i)
+        {
+            if (numStages == 1) {
+                last.push(low[i], output);
+                output += 2;
+                continue;
+            }
+
+            Type middle[2];
+            interpolators[stageIndex(1, channel)].push(low[i], middle);
+            last.push(middle[0], output);
+            last.push(middle[1], output + 2);
+            output += 4;
+        }
+    }
+
+    ProcessorType processor;
+
+    std::vector<HalfBandDecimator<Type>> decimators;
+    std::vector<HalfBandInterpolator<Type>> interpolators;
+
+    juce::AudioBuffer<Type> lowRate, pending;
+    int factor = 1, numStages = 0, numChannels = 0, kernelSize = 0, numPending = 0;
+};
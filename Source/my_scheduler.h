@@ -0,0 +1,167 @@
+/*
+  ==============================================================================
+
+    my_scheduler.h
+    Author:  Steven Vidal
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <typeindex>
+#include "my_denormals.h"
+
+class PrecomputeScheduler;
+
+/**
+ result of a precompute job, shared by every instance that submitted the same key.
+ the worker publishes the value once with a release store so isReady() can be polled from any thread
+ (including the audio thread) without taking a lock
+ */
+template <typename ResultType>
+class PrecomputeResult
+{
+public:
+    bool isReady() const noexcept { return ready.load(std::memory_order_acquire); }
+
+    const ResultType& get() const noexcept {
+        jassert(isReady());
+        return value;
+    }
+
+private:
+    friend class PrecomputeScheduler;
+
+    void publish(ResultType&& newValue) {
+        value = std::move(newValue);
+        ready.store(true, std::memory_order_release);
+    }
+
+    ResultType value{};
+    std::atomic<bool> ready{false};
+};
+
+/**
+ process wide pool of low priority worker threads for the heavy setup work (IR loading and decoding).
+ every instance holds it through juce::SharedResourcePointer<PrecomputeScheduler>, so all instances in a
+ session share the same threads. jobs are keyed, submitting a key that is already queued, running or
+ still held by someone hands back the same result instead of doing the work again, so loading a big
+ session costs the unique work only. keys should start with what they are ("ir:"...)
+ */
+class PrecomputeScheduler
+{
+public:
+    PrecomputeScheduler()
+    {
+        auto numWorkers = juce::jlimit(1, 2, juce::SystemStats::getNumCpus() / 4);
+
+        for (int i = 0; i < numWorkers; ++i)
+        {
+            auto* worker = workers.add(new Worker(*this));
+
+           #if JUCE_MAJOR_VERSION >= 7
+            worker->startThread(juce::Thread::Priority::background);
+           #else
+            worker->startThread(1);
+           #endif
+        }
+    }
+
+    ~PrecomputeScheduler()
+    {
+        for (auto* worker : workers)
+            worker->signalThreadShouldExit();
+
+        for (auto* worker : workers)
+        {
+            jobAvailable.signal();
+            worker->stopThread(2000);
+        }
+    }
+
+    /** never call this from the audio thread, it takes a lock and allocates*/
+    template <typename ResultType>
+    std::shared_ptr<PrecomputeResult<ResultType>> submit(const juce::String& key, std::function<ResultType()> work)
+    {
+        const juce::ScopedLock sl(lock);
+
+        auto existing = results.find(key);
+        if (existing != results.end())
+        {
+            //the same key submitted with two different result types, the second one gets its own job
+            jassert(existing->second.type == std::type_index(typeid(ResultType)));
+
+            if (existing->second.type == std::type_index(typeid(ResultType)))
+                if (auto shared = existing->second.result.lock())
+                    return std::static_pointer_cast<PrecomputeResult<ResultType>>(shared);
+        }
+
+        //drop the entries nobody holds anymore
+        for (auto it = results.begin(); it != results.end();)
+            it = it->second.result.expired() ? results.erase(it) : std::next(it);
+
+        auto result = std::make_shared<PrecomputeResult<ResultType>>();
+        results.erase(key);
+        results.emplace(key, Entry { result, std::type_index(typeid(ResultType)) });
+
+        queue.push_back([result, work] { result->publish(work()); });
+        ++numJobsQueued;
+        jobAvailable.signal();
+        return result;
+    }
+
+    /** number of jobs that were actually queued, submissions that got an existing result back don't count*/
+    int getNumJobsQueued() const noexcept { return numJobsQueued.load(); }
+
+private:
+    class Worker : public DenormalSafeThread
+    {
+    public:
+        explicit Worker(PrecomputeScheduler& owner) : DenormalSafeThread("ampsim precompute"), scheduler(owner) {}
+
+        void runWorker() override
+        {
+            while (! threadShouldExit())
+            {
+                if (auto job = scheduler.popJob())
+                    job();
+                else
+                    scheduler.jobAvailable.wait(100);
+            }
+        }
+
+    private:
+        PrecomputeScheduler& scheduler;
+    };
+
+    std::function<void()> popJob()
+    {
+        const juce::ScopedLock sl(lock);
+
+        if (queue.empty())
+            return {};
+
+        auto job = std::move(queue.front());
+        queue.pop_front();
+        return job;
+    }
+
+    /** the result is type erased, the type it was made with is kept so a lookup can't cast it to something else*/
+    struct Entry
+    {
+        std::weak_ptr<void> result;
+        std::type_index type;
+    };
+
+    juce::CriticalSection lock;
+    std::map<juce::String, Entry> results;
+    std::deque<std::function<void()>> queue;
+
+    juce::WaitableEvent jobAvailable;
+    std::atomic<int> numJobsQueued{0};
+    juce::OwnedArray<Worker> workers;
+
+    JUCE_DECLARE_NON_COPYABLE (PrecomputeScheduler)
+};